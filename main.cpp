@@ -47,6 +47,89 @@ print(a)
 #include <string>
 #include <vector>
 #include <tuple>
+#include <deque>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdlib>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define KEYFRAME_HAS_RUSAGE 1
+#endif
+
+// The replaced allocation functions are kept out of line, otherwise GCC sees malloc and free meet at the
+// inlined call sites of new and delete and reports them as mismatched
+#if defined(__GNUC__)
+#define KEYFRAME_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define KEYFRAME_NOINLINE __declspec(noinline)
+#else
+#define KEYFRAME_NOINLINE
+#endif
+
+
+// Runtime statistics
+/*
+
+  When the interpreter is launched with --stats, every heap allocation is counted by the replaced global
+  operator new below. This catches the allocations hidden inside Token copies, nested token vectors and
+  memory variables, which is where most of the interpreter's allocations come from.
+  The totals cover every thread. Statements and functions are attributed from the counters of the thread
+  running them, so the tables are only exact while a single interpreter runs on that thread.
+
+*/
+std::atomic<bool> stats_enabled(false); // Counting is only done when --stats is passed, only main() sets this
+thread_local bool stats_paused = false; // Set while this thread does its own bookkeeping, which should not be counted
+std::atomic<size_t> stats_allocations(0); // Total number of heap allocations over all threads, the lexer may allocate from several
+std::atomic<size_t> stats_bytes(0); // Total number of bytes requested from the heap over all threads
+thread_local size_t thread_allocations = 0; // Allocations of this thread only, per statement snapshots are taken from these
+thread_local size_t thread_bytes = 0;
+
+KEYFRAME_NOINLINE void* operator new(size_t size){
+  if (stats_enabled.load(std::memory_order_relaxed) && !stats_paused){
+    stats_allocations++;
+    stats_bytes += size;
+    thread_allocations++;
+    thread_bytes += size;
+  }
+
+  void* pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr){
+    throw std::bad_alloc();
+  }
+
+  return pointer;
+}
+
+KEYFRAME_NOINLINE void operator delete(void* pointer) noexcept{
+  std::free(pointer);
+}
+
+KEYFRAME_NOINLINE void operator delete(void* pointer, size_t) noexcept{
+  std::free(pointer);
+}
+
+size_t peakResidentMemory(){
+  // Returns the peak resident memory of the process in kilobytes, or 0 where the platform does not report it
+#ifdef KEYFRAME_HAS_RUSAGE
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024; // Reported in bytes on macOS
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
 
 
 // Helpers
@@ -123,30 +206,119 @@ class Lexer{
   public:
     // Public variables
     std::string& input;
+    static const size_t parallel_threshold = 1 << 20; // Inputs of at least this many characters are lexed on multiple threads
 
     // Constructor
     Lexer(std::string& input) : input(input) {}
 
     std::vector<Token> tokenize() const{
+      const size_t workers = std::thread::hardware_concurrency();
+      if (input.size() < parallel_threshold || workers < 2){
+        return tokenize_range(0, input.size());
+      }
+
+      return tokenize_parallel(workers);
+    }
+
+    std::vector<Token> tokenize_parallel(size_t workers) const{
+      /*
+
+        Splits the input into chunks right after newlines and lexes each chunk on its own thread.
+        A newline outside of strings and arrays leaves the lexer with no pending capture, so lexing the chunks
+        separately and concatenating the results gives exactly the tokens of the serial lexer.
+
+      */
+
+      // Speculatively split the input evenly, right after the nearest newline
+      std::vector<size_t> bounds;
+      bounds.push_back(0);
+      for (size_t k = 1; k < workers; k++){
+        const size_t split = input.find('\n', std::max(bounds.back(), input.size() * k / workers));
+        if (split == std::string::npos || split + 1 >= input.size()){
+          break;
+        }
+
+        bounds.push_back(split + 1);
+      }
+
+      bounds.push_back(input.size());
+      const size_t chunks = bounds.size() - 1;
+
+      // Pre-pass: the quotes and brackets state at any position only depends on how many quotes and brackets precede it
+      std::vector<size_t> chunk_quotes(chunks, 0);
+      std::vector<size_t> chunk_brackets(chunks, 0);
+      std::vector<std::thread> threads;
+      for (size_t c = 0; c < chunks; c++){
+        threads.push_back(std::thread([this, &bounds, &chunk_quotes, &chunk_brackets, c](){
+          for (size_t pos = bounds[c]; pos < bounds[c + 1]; pos++){
+            if (input[pos] == '"'){
+              chunk_quotes[c] ^= 1;
+            } else if (input[pos] == '['){
+              chunk_brackets[c]++;
+            } else if (input[pos] == ']'){
+              chunk_brackets[c]--; // Wraps around exactly like the serial lexer's counter does
+            }
+          }
+        }));
+      }
+
+      for (size_t c = 0; c < chunks; c++){
+        threads[c].join();
+      }
+
+      // Only keep the splits which are not within a string or an array, merging the chunks around the others
+      std::vector<size_t> splits;
+      splits.push_back(0);
+      size_t quotes = 0;
+      size_t brackets = 0;
+      for (size_t c = 0; c + 1 < chunks; c++){
+        quotes ^= chunk_quotes[c];
+        brackets += chunk_brackets[c];
+        if (quotes == 0 && brackets == 0){
+          splits.push_back(bounds[c + 1]);
+        }
+      }
+
+      splits.push_back(input.size());
+
+      // Lex the chunks on worker threads
+      std::vector<std::vector<Token>> results(splits.size() - 1);
+      threads.clear();
+      for (size_t c = 0; c < results.size(); c++){
+        threads.push_back(std::thread([this, &splits, &results, c](){
+          results[c] = tokenize_range(splits[c], splits[c + 1]);
+        }));
+      }
+
+      size_t total = 0;
+      for (size_t c = 0; c < results.size(); c++){
+        threads[c].join();
+        total += results[c].size();
+      }
+
+      std::vector<Token> tokens;
+      tokens.reserve(total);
+      for (size_t c = 0; c < results.size(); c++){
+        tokens.insert(tokens.end(), std::make_move_iterator(results[c].begin()), std::make_move_iterator(results[c].end()));
+      }
+
+      return tokens;
+    }
+
+    std::vector<Token> tokenize_range(size_t begin, size_t end) const{
+      // Lexes input[begin, end), starting outside of any string or array
       std::vector<Token> tokens; // A vector consisting of all the tokens
       
       // Recognized symbols
       char symbols[] = {':', ',', '(', ')', '{', '}', '=', '+', '!'};
-      std::string keywords[] = {"dec", "print", "if", "for", "function", "return", "and", "or"};
       
       std::string capture = ""; // A substring of each token capture at a given pos
-      size_t pos = 0; // A sliding pointer along the string to capture individual chars
+      size_t pos = begin; // A sliding pointer along the string to capture individual chars
       size_t quotes = 0; // 0 quotes means we are not capturing a string, 1 means we are capturing a string
       size_t brackets = 0; // 0 brackets means we are not within the context of an array, 1 or more means we are
-      while (pos < input.size()){ // Iterate through the whole string
+      while (pos < end){ // Iterate through the whole string
         char curr = input[pos]; // Store the current char
         
-        if (curr == '\n'){
-          // Breaking into a new line
-          tokens.push_back(Token("newline", ""));
-          continue;
-        }
-
         if (brackets > 0 && curr == ','){
           // We are currently capturing an array, therefore we neglect commas as individual tokens
           capture += curr;
@@ -167,31 +339,7 @@ class Lexer{
         if ((std::isspace(curr) && quotes == 0 && brackets == 0) || isSymbol){
           // When spaces (not within strings) or any symbols are captured we have to push back the current token
           if (capture.size() > 0){ // There is a token to capture
-            bool recognized = false;
-            for (unsigned int i = 0; i < sizeof(keywords); i++){
-              if (capture == keywords[i]){
-                // This is a recognized keyword
-                tokens.push_back(Token("keyword", capture));
-                recognized = true;
-                break;
-              }
-            }
-
-            if (!recognized){
-              // Undetected symbol
-              if (capture == "true" || capture == "false"){
-                tokens.push_back(Token("boolean", capture));
-              } else if (capture[0] == '"' && capture[capture.size() - 1] == '"'){
-                tokens.push_back(Token("string", capture));
-              } else if (stringIsNumber(capture)) {
-                tokens.push_back(Token("number", capture));
-              } else if (capture[0] == '[' && capture[capture.size() - 1] == ']'){
-                tokens.push_back(Token("array", capture));
-              } else {
-                tokens.push_back(Token("unknown", capture));
-              }
-            }
-            
+            push_capture(tokens, capture);
             capture = "";
           }
 
@@ -199,6 +347,11 @@ class Lexer{
             std::string symbol = std::string(1, curr);
             tokens.push_back(Token("symbol", symbol));
           }
+
+          if (curr == '\n'){
+            // Breaking into a new line, newlines within strings and arrays are captured like any other whitespace
+            tokens.push_back(Token("newline", ""));
+          }
         } else {
           capture += curr; // Concat current char to capture string
         }
@@ -219,33 +372,58 @@ class Lexer{
       }
 
       if (capture.size() > 0){ // There is a token to capture
-        bool recognized = false;
-        for (unsigned int i = 0; i < sizeof(keywords); i++){
-          if (capture == keywords[i]){
-            // This is a recognized keyword
-            tokens.push_back(Token("keyword", capture));
-            recognized = true;
-            break;
-          }
-        }
+        push_capture(tokens, capture);
+      }
 
-        if (!recognized){
-          // Undetected symbol
-          if (capture == "true" || capture == "false"){
-            tokens.push_back(Token("boolean", capture));
-          } else if (capture[0] == '"' && capture[capture.size() - 1] == '"'){
-            tokens.push_back(Token("string", capture));
-          } else if (stringIsNumber(capture)) {
-            tokens.push_back(Token("number", capture));
-          } else if (capture[0] == '[' && capture[capture.size() - 1] == ']'){
-            tokens.push_back(Token("array", capture));
-          } else {
-            tokens.push_back(Token("unknown", capture));
-          }
+      return tokens;
+    }
+
+  private:
+    static void push_capture(std::vector<Token>& tokens, const std::string& capture){
+      // Classifies a captured word and pushes it as a token
+      static const std::string keywords[] = {"dec", "print", "if", "for", "function", "return", "and", "or"};
+      for (unsigned int i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++){
+        if (capture == keywords[i]){
+          // This is a recognized keyword
+          tokens.push_back(Token("keyword", capture));
+          return;
         }
       }
 
-      return tokens;
+      // Undetected symbol
+      if (capture == "true" || capture == "false"){
+        tokens.push_back(Token("boolean", capture));
+      } else if (capture[0] == '"' && capture[capture.size() - 1] == '"'){
+        tokens.push_back(Token("string", capture));
+      } else if (stringIsNumber(capture)) {
+        tokens.push_back(Token("number", capture));
+      } else if (capture[0] == '[' && capture[capture.size() - 1] == ']'){
+        tokens.push_back(Token("array", capture));
+      } else {
+        tokens.push_back(Token("unknown", capture));
+      }
+    }
+};
+
+class StatsEntry
+{
+  /*
+
+    Accumulated statistics of a single statement kind or function.
+    Allocations, bytes and tokens are inclusive of any nested statements and function calls.
+
+  */
+
+  public:
+    std::string name;
+    size_t count = 0; // How many times the statement or function was executed
+    size_t allocations = 0;
+    size_t bytes = 0;
+    size_t tokens = 0;
+    StatsEntry(std::string n) : name(n) {}
+    void print() const
+    {
+      std::cout << "  " << name << ": " << count << " runs, " << allocations << " allocations, " << bytes << " bytes, " << tokens << " tokens" << std::endl;
     }
 };
 
@@ -259,15 +437,249 @@ std::vector<std::string> constructMemoryVariable(std::string& type,
   return variable;
 }
 
+template <typename T>
+class LayeredVector
+{
+  /*
+
+    A vector shared between forked interpreters. freeze() turns the current elements into an immutable base, which
+    this vector and the returned copy both build upon. Afterwards each side appends its own elements and keeps its own
+    copies of the base elements it writes to, so neither forking nor writing copies more than the written element.
+
+  */
+
+  public:
+    size_t size() const
+    {
+      return base_size + own.size();
+    }
+
+    const T& get(size_t i) const
+    {
+      if (i >= base_size){
+        return own[i - base_size];
+      }
+
+      typename std::map<size_t, T>::const_iterator written = overrides.find(i);
+      if (written != overrides.end()){
+        return written->second;
+      }
+
+      return base->get(i);
+    }
+
+    T& edit(size_t i)
+    {
+      if (i >= base_size){
+        return own[i - base_size];
+      }
+
+      typename std::map<size_t, T>::iterator written = overrides.find(i);
+      if (written == overrides.end()){
+        written = overrides.insert(std::make_pair(i, base->get(i))).first; // Copy only the element being written
+      }
+
+      return written->second;
+    }
+
+    void push_back(const T& value)
+    {
+      own.push_back(value);
+    }
+
+    LayeredVector freeze()
+    {
+      if (!own.empty() || !overrides.empty()){
+        std::shared_ptr<const LayeredVector> frozen = std::make_shared<const LayeredVector>(std::move(*this));
+        own.clear();
+        overrides.clear();
+        base = frozen;
+        base_size = frozen->size();
+      }
+
+      return *this;
+    }
+
+  private:
+    std::shared_ptr<const LayeredVector> base; // Elements [0, base_size) shared with forked copies
+    size_t base_size = 0;
+    std::map<size_t, T> overrides; // Own copies of the base elements written to
+    std::vector<T> own; // Elements appended after the base
+};
+
+template <typename V>
+class LayeredMap
+{
+  /*
+
+    A map from names shared between forked interpreters, layered the same way as LayeredVector.
+    Lookups go through the own entries first and the frozen base after, writes only ever touch the own entries.
+
+  */
+
+  public:
+    const V* find(const std::string& key) const
+    {
+      typename std::map<std::string, V>::const_iterator entry = own.find(key);
+      if (entry != own.end()){
+        return &entry->second;
+      }
+
+      return base ? base->find(key) : nullptr;
+    }
+
+    V& edit(const std::string& key)
+    {
+      typename std::map<std::string, V>::iterator entry = own.find(key);
+      if (entry == own.end()){
+        const V* inherited = base ? base->find(key) : nullptr;
+        entry = own.insert(std::make_pair(key, inherited ? *inherited : V())).first;
+      }
+
+      return entry->second;
+    }
+
+    size_t size() const
+    {
+      // Entries written on both layers are counted twice, which is good enough for memory estimates
+      return own.size() + (base ? base->size() : 0);
+    }
+
+    LayeredMap freeze()
+    {
+      if (!own.empty()){
+        std::shared_ptr<const LayeredMap> frozen = std::make_shared<const LayeredMap>(std::move(*this));
+        own.clear();
+        base = frozen;
+      }
+
+      return *this;
+    }
+
+  private:
+    std::shared_ptr<const LayeredMap> base;
+    std::map<std::string, V> own;
+};
+
+class FunctionBody
+{
+  /*
+
+    A declared function's body. Until the function is first called, it is only kept as a token range within the block
+    it was declared in. The first call copies the range out and caches it, so uncalled code is never copied.
+    The cache is shared by forked interpreters, which may run on different threads, so it is filled with std::call_once.
+    FunctionBody(std::shared_ptr<const std::vector<Token>> source, size_t start, size_t end)
+
+  */
+
+  public:
+    std::shared_ptr<const std::vector<Token>> source; // Tokens of the block which declared the function
+    size_t start; // Range of the body within source
+    size_t end;
+    FunctionBody(std::shared_ptr<const std::vector<Token>> s, size_t b, size_t e) : source(s), start(b), end(e), cache(std::make_shared<Cache>()) {}
+    std::shared_ptr<const std::vector<Token>> compile() const
+    {
+      std::call_once(cache->once, [this](){
+        cache->body = std::make_shared<const std::vector<Token>>(source->begin() + start, source->begin() + end);
+        cache->compiled = cache->body.get();
+      });
+
+      return cache->body;
+    }
+
+    const std::vector<Token>* compiled() const
+    {
+      // The cached body, nullptr while the function was never called
+      return cache->compiled;
+    }
+
+  private:
+    class Cache
+    {
+      public:
+        std::once_flag once;
+        std::shared_ptr<const std::vector<Token>> body;
+        std::atomic<const std::vector<Token>*> compiled{nullptr}; // Readable without waiting for a compilation in progress
+    };
+
+    std::shared_ptr<Cache> cache; // Shared by every copy of this body
+};
+
+class FunctionMemo
+{
+  /*
+
+    Purity information about a declared function, and the last result it has returned.
+    A function is pure when it does not print, declare or assign anything and only calls pure functions,
+    meaning its result depends only on the global variables it reads.
+
+  */
+
+  public:
+    bool analyzed = false;
+    bool pure = false;
+    std::vector<std::string> reads; // Global variables read by the function and its callees
+    std::string missing = ""; // A callee which was not declared yet when analyzed, the analysis is only retried once it is
+    size_t declared = 0; // Number of declared functions when missing was last looked up
+    bool cached = false;
+    std::vector<size_t> versions; // Versions of the read variables when the result was cached
+    Token result = Token("", "");
+};
+
+class Frame
+{
+  /*
+
+    A suspended block, saved while a nested block (a for loop body, an if body or a function body) is being executed.
+    Frame(std::shared_ptr<const std::vector<Token>> tokens, size_t start_pc, size_t end_pc, size_t pc, size_t line)
+
+  */
+
+  public:
+    std::shared_ptr<const std::vector<Token>> tokens; // Tokens containing the suspended block
+    size_t start_pc; // Range of the suspended block within tokens
+    size_t end_pc;
+    size_t pc; // Index of the statement to resume from
+    size_t line;
+    size_t repeat = 1; // Passes left through the nested block
+    std::string kind = ""; // Statement kind which entered the nested block
+    std::string function = ""; // Name of the function being called, if the nested block is a function body
+    bool restart = false; // The function was called within an expression, the suspended statement is restarted with its result
+    size_t allocations_before = 0; // Counters snapshot for --stats, taken when the statement entering the block began
+    size_t bytes_before = 0;
+    size_t tokens_before = 0;
+    Frame(std::shared_ptr<const std::vector<Token>> t, size_t s, size_t e, size_t p, size_t l) : tokens(t), start_pc(s), end_pc(e), pc(p), line(l) {}
+};
+
 class Interpreter{
   /* 
     The interpreter receives tokens and executes the code. 
   */
 
   public:
-    std::vector<Token> tokens;
-    std::vector<std::vector<std::string>> memory; // Variables memory
-    std::vector<std::tuple<std::string, std::vector<Token>>> memory_functions; // Unique memory for function tokens
+    std::shared_ptr<const std::vector<Token>> source; // Tokens containing the block being executed
+    size_t start_pc = 0; // Range of the block being executed within source, for and if bodies are not copied out of it
+    size_t end_pc;
+    LayeredVector<std::vector<std::string>> memory; // Variables memory
+    LayeredVector<std::tuple<std::string, FunctionBody>> memory_functions; // Unique memory for function tokens
+    size_t tokens_evaluated = 0; // Tokens visited by execute and evaluate_experssion
+    std::vector<StatsEntry> stats_statements; // Statistics per statement kind (only filled with --stats)
+    std::vector<StatsEntry> stats_functions; // Statistics per function (only filled with --stats)
+    std::vector<Frame> frames; // Suspended blocks, the innermost being last
+    size_t pc = 0; // Index of the next statement within tokens
+    size_t line = 1; // Current line index
+    std::shared_ptr<const std::vector<Token>> call_body; // Body of a function called within an expression, entered once the statement suspends
+    std::string call_function = "";
+    bool call_ready = false; // Set when a restarted statement should receive call_result instead of calling again
+    Token call_result = Token("", "");
+    size_t call_allocations_before = 0; // Counters snapshot of the statement being restarted
+    size_t call_bytes_before = 0;
+    size_t call_tokens_before = 0;
+    size_t steps = 0; // Statements executed so far
+    size_t step_quota = 0; // Maximum statements to execute before aborting, 0 means unlimited
+    size_t memory_quota = 0; // Maximum bytes as reported by memory_usage() before aborting, 0 means unlimited
+    LayeredMap<size_t> variable_versions; // Incremented on every write to a variable, used to validate memoized results
+    LayeredMap<FunctionMemo> memo_functions; // Purity and cached results of called functions
 
     /*
 
@@ -277,16 +689,38 @@ class Interpreter{
 
       The memory functions layout is as follows:
 
-      [ [ (function_name  , function_tokens) ], ... ]
+      [ [ (function_name  , function_body) ], ... ]
+
+      Both are shared with forked interpreters, and a write only copies the variable or function it writes to.
 
     */
 
-    Interpreter(std::vector<Token> tokens) : tokens(tokens) {}
+    Interpreter(std::vector<Token> tokens) : source(std::make_shared<const std::vector<Token>>(tokens)), end_pc(source->size()) {}
+
+    Interpreter fork(std::vector<Token> local_tokens){
+      /*
+
+        Returns a child interpreter which executes local_tokens on top of this interpreter's variables and functions,
+        e.g. variants of a script sharing the same prelude. The current state is frozen and shared by both, and each
+        side only copies the entries it writes to afterwards.
+        Forks may run on different threads, but fork() itself must not be called while this interpreter is running.
+
+      */
+
+      Interpreter child = Interpreter(local_tokens);
+      child.memory = memory.freeze();
+      child.memory_functions = memory_functions.freeze();
+      child.variable_versions = variable_versions.freeze();
+      child.memo_functions = memo_functions.freeze();
+      child.step_quota = step_quota;
+      child.memory_quota = memory_quota;
+      return child;
+    }
 
     std::vector<std::string> find_variable(std::string name){
       for (unsigned int i = 0; i < memory.size(); i++){
-        if (memory[i][1] == name){
-          return memory[i];
+        if (memory.get(i)[1] == name){
+          return memory.get(i);
         }
       }
 
@@ -294,24 +728,244 @@ class Interpreter{
     }
 
     Token run_function(std::string name){
+      /*
+
+        Calls a function within an expression. The body is not executed here, since the statement could not be suspended
+        halfway through it. Instead the body is requested through call_body, the statement suspends and the body runs in
+        its own frame. Once it finishes, the statement is restarted from its beginning and receives the result here.
+        Expressions have no side effects before their call, so evaluating them again is safe.
+
+      */
+
+      if (call_ready){
+        call_ready = false;
+        return call_result;
+      }
+
+      Token cached = Token("", "");
+      if (memo_lookup(name, cached)){
+        return cached;
+      }
+
       for (unsigned int i = 0; i < memory_functions.size(); i++){
-        std::tuple<std::string, std::vector<Token>> function_metadata = memory_functions[i];
-        std::string local_name = std::get<0>(function_metadata);
-        std::vector<Token> local_tokens = std::get<1>(function_metadata);
+        const std::tuple<std::string, FunctionBody>& function_metadata = memory_functions.get(i);
+        const std::string& local_name = std::get<0>(function_metadata);
         if (local_name == name){
-          Token ret = execute(local_tokens); // Store what the function call has returned
-          return ret;
+          call_body = std::get<1>(function_metadata).compile();
+          call_function = name;
+          return Token("run_type", "CALL"); // CALL indicates that the statement has to suspend until the function returns
         }
       }
       
       return Token("search", "LOST"); // LOST indicates that the search did not find anything
     }
 
+    void write_variable(std::string name){
+      // Every write to a variable invalidates the memoized results of functions reading it
+      variable_versions.edit(name)++;
+    }
+
+    const FunctionBody* find_function(std::string name){
+      // Returns the declared body of a function, or nullptr if no function with that name was declared yet
+      for (unsigned int i = 0; i < memory_functions.size(); i++){
+        if (std::get<0>(memory_functions.get(i)) == name){
+          return &std::get<1>(memory_functions.get(i));
+        }
+      }
+
+      return nullptr;
+    }
+
+    bool is_pure(std::string name){
+      /*
+
+        Statically analyzes whether a function is pure, collecting the global variables it reads.
+        Recursive functions are treated as impure. Functions calling functions which are not declared yet are
+        treated as impure for now, and are analyzed again once the missing callee is declared.
+
+      */
+
+      const FunctionMemo* known = memo_functions.find(name);
+      if (known != nullptr && known->analyzed){
+        return known->pure;
+      }
+
+      if (known != nullptr && known->missing != ""){
+        // Functions are only ever added, so the missing callee can only have been declared if their number has changed
+        if (known->declared == memory_functions.size()){
+          return false;
+        }
+
+        if (find_function(known->missing) == nullptr){
+          memo_functions.edit(name).declared = memory_functions.size();
+          return false;
+        }
+      }
+
+      const FunctionBody* function = find_function(name);
+      if (function == nullptr){
+        return false;
+      }
+
+      FunctionMemo& memo = memo_functions.edit(name); // References into a map stay valid while callees are inserted
+      memo.analyzed = true; // Marked before analyzing the callees, so recursion is reported as impure
+
+      // The body is scanned where it was declared, so analyzing a function does not compile its callees
+      const std::vector<Token>& body = *function->source;
+      const size_t start = function->start;
+      const size_t end = function->end;
+
+      std::vector<std::string> reads;
+      for (size_t i = start; i < end; i++){
+        const Token& curr = body[i];
+        if (curr.type == "keyword" && (curr.value == "print" || curr.value == "dec" || curr.value == "function")){
+          return false;
+        }
+
+        if (curr.type != "unknown" || (i > start && body[i - 1].type == "keyword" && body[i - 1].value == "for")){
+          // Loop variables are not stored in memory
+          continue;
+        }
+
+        const bool followed_by_symbol = i + 1 < end && body[i + 1].type == "symbol";
+        if (followed_by_symbol && body[i + 1].value == "("){
+          // A call, its reads become ours
+          if (!is_pure(curr.value)){
+            const FunctionMemo* callee = memo_functions.find(curr.value);
+            if (callee == nullptr || !callee->analyzed){
+              // The callee, or one of its own callees, is not declared yet, so neither are we decided
+              memo.analyzed = false;
+              memo.missing = callee == nullptr ? curr.value : callee->missing;
+              memo.declared = memory_functions.size();
+            }
+
+            return false;
+          }
+
+          const std::vector<std::string> callee_reads = memo_functions.find(curr.value)->reads;
+          reads.insert(reads.end(), callee_reads.begin(), callee_reads.end());
+          continue;
+        }
+
+        if (followed_by_symbol && body[i + 1].value == "=" && !(i + 2 < end && body[i + 2].type == "symbol" && body[i + 2].value == "=")){
+          // An assignment to a global variable
+          return false;
+        }
+
+        // Reading a variable, or an element of an array variable
+        const int first_occurance = firstOccurance(curr.value, '[');
+        reads.push_back(first_occurance == -1 ? curr.value : curr.value.substr(0, first_occurance));
+      }
+
+      memo.pure = true;
+      memo.reads = reads;
+      return true;
+    }
+
+    size_t read_version(const std::string& name){
+      // Variables which were never written have version 0
+      const size_t* version = variable_versions.find(name);
+      return version == nullptr ? 0 : *version;
+    }
+
+    bool memo_lookup(std::string name, Token& result){
+      // Returns true and the cached result if the function is pure and none of the variables it reads have changed since
+      if (!is_pure(name)){
+        return false;
+      }
+
+      const FunctionMemo& memo = *memo_functions.find(name);
+      if (!memo.cached){
+        return false;
+      }
+
+      // Compared in place, a lookup should not allocate
+      for (unsigned int i = 0; i < memo.reads.size(); i++){
+        if (memo.versions[i] != read_version(memo.reads[i])){
+          return false;
+        }
+      }
+
+      result = memo.result;
+      return true;
+    }
+
+    void memo_store(std::string name, Token result){
+      /*
+
+        Caches the result of a pure function. Only the latest result is kept, since variable versions only ever
+        increase and an older set of versions can never be matched again.
+
+      */
+
+      if (!is_pure(name)){
+        return;
+      }
+
+      FunctionMemo& memo = memo_functions.edit(name);
+      memo.cached = true;
+      memo.versions.resize(memo.reads.size());
+      for (unsigned int i = 0; i < memo.reads.size(); i++){
+        memo.versions[i] = read_version(memo.reads[i]);
+      }
+
+      memo.result = result;
+    }
+
+    void record_stats(std::vector<StatsEntry>& entries, std::string name, size_t allocations_before, size_t bytes_before, size_t tokens_before){
+      // Attributes everything counted since the given snapshot to the entry with a matching name
+      if (!stats_enabled){
+        return;
+      }
+
+      const size_t allocations = thread_allocations - allocations_before;
+      const size_t bytes = thread_bytes - bytes_before;
+      stats_paused = true; // The bookkeeping itself should not be counted
+      
+      unsigned int i = 0;
+      while (i < entries.size() && entries[i].name != name){
+        i++;
+      }
+
+      if (i == entries.size()){
+        entries.push_back(StatsEntry(name));
+      }
+
+      entries[i].count++;
+      entries[i].allocations += allocations;
+      entries[i].bytes += bytes;
+      entries[i].tokens += tokens_evaluated - tokens_before;
+      stats_paused = false;
+    }
+
+    std::string statement_kind(size_t i){
+      // Returns the kind of statement starting at token i, or an empty string if there is none
+      const std::vector<Token>& tokens = *source;
+      const Token curr = tokens[i];
+      if (curr.type == "keyword" && curr.value != "and" && curr.value != "or"){
+        return curr.value;
+      }
+
+      if (curr.type == "unknown" && i + 1 < end_pc && tokens[i + 1].type == "symbol"){
+        if (tokens[i + 1].value == "("){
+          return "call";
+        }
+
+        if (tokens[i + 1].value == "="){
+          return "assign";
+        }
+      }
+
+      return "";
+    }
+
     Token evaluate_experssion(std::vector<Token> local_tokens){
       /* 
         Nested tokens within some experession will be evaluated using this method 
         The indexing checks are done to prevent Segmentation Faults
       */
+
+      tokens_evaluated += local_tokens.size();
             
       // The expression is potentially a boolean expression
       if (local_tokens.size() > 3 && local_tokens[1].type == "symbol" && local_tokens[1].value == "=" && local_tokens[2].type == "symbol" && local_tokens[2].value == "="){
@@ -445,18 +1099,13 @@ class Interpreter{
       std::cout << message << " (line " << line << ")" << std::endl; 
     }
 
-    std::tuple<std::vector<Token>, int> get_nested_tokens(size_t start, std::string open, std::string close){
-      /*
-
-        Returns all localized nested tokens between characters (start, close), and an index-pointer to the end of the nested tokens.
-
-      */
-      
-      std::vector<Token> nested_tokens;
+    size_t find_closing(size_t start, std::string open, std::string close){
+      // Returns an index-pointer to the end of the nested tokens starting at start, without copying them
+      const std::vector<Token>& tokens = *source;
       size_t j = start;
       size_t brackets = 1; // Counter for how many brackets are left within the scope of this for loop. Once this reaches zero we have gone off the for loop.
-      while (j < tokens.size() && brackets > 0){
-        Token j_curr = tokens[j];
+      while (j < end_pc && brackets > 0){
+        const Token& j_curr = tokens[j];
         if (j_curr.type == "symbol" && j_curr.value == open){
           brackets++;
         } else if (j_curr.type == "symbol" && j_curr.value == close) {
@@ -467,157 +1116,256 @@ class Interpreter{
           break;
         }
 
-        nested_tokens.push_back(tokens[j]);
         j++;
       }
 
+      return j;
+    }
+
+    std::tuple<std::vector<Token>, int> get_nested_tokens(size_t start, std::string open, std::string close){
+      /*
+
+        Returns all localized nested tokens between characters (start, close), and an index-pointer to the end of the nested tokens.
+
+      */
+      
+      const size_t j = find_closing(start, open, close);
+      std::vector<Token> nested_tokens(source->begin() + std::min(start, j), source->begin() + j);
       return std::make_tuple(nested_tokens, j);
     }
 
-    Token execute(){
-      // Iterate through the tokens
-      size_t l = 1; // Current line index
-      size_t i = 0; // Current token index
-      while (i < tokens.size()){
-        // First run through, evaluating any boolean expressions or mathematical expressions
-        Token curr = tokens[i];
-
-        if (curr.type == "ignore"){ // Skip scan on ignored tokens
-          i++;
-          continue;
-        }
-        
-        if (curr.type == "newline"){
-          l++;
-          continue;
-        }
+    void enter(std::shared_ptr<const std::vector<Token>> block, size_t block_start, size_t block_end, size_t repeat, std::string kind, std::string function, size_t allocations_before, size_t bytes_before, size_t tokens_before){
+      /*
 
-        /*
-        if (curr.type == "symbol" && curr.value == "=" && tokens[i + 1].type == "symbol" && tokens[i + 1].value == "="){
-          Token left = tokens[i - 1];
-          Token right = tokens[i + 2];
-          if (left.type == right.type){
-            tokens.erase(tokens.begin() + i - 1);
-            tokens.erase(tokens.begin() + i - 1);
-            tokens.erase(tokens.begin() + i - 1);
-            tokens[i - 1].type = "boolean";
-            if (left.value == right.value){
-              tokens[i - 1].value = "true";
-            } else {
-              tokens[i - 1].value = "false";
-            }
-          } else {
-            // Comparison between different types.
-            output_log("Attempt to compare different types", l);
-          }
+        Suspends the current block and starts executing a nested one (a for loop body, an if body or a function body).
+        The nested block is the range [block_start, block_end) of block, and is executed `repeat` times before the suspended block is resumed.
+
+      */
+
+      if (repeat == 0){
+        // The block is never executed, e.g. for i = (5, 1)
+        if (kind != ""){
+          record_stats(stats_statements, kind, allocations_before, bytes_before, tokens_before);
         }
-        */
 
-        i++;
+        return;
       }
 
-      l = 1; // Current line index
-      i = 0;
-      while (i < tokens.size()){
-        Token curr = tokens[i];
-        if (curr.type == "newline"){
-          l++;
-          continue;
+      Frame frame = Frame(source, start_pc, end_pc, pc, line);
+      frame.repeat = repeat;
+      frame.kind = kind;
+      frame.function = function;
+      frame.allocations_before = allocations_before;
+      frame.bytes_before = bytes_before;
+      frame.tokens_before = tokens_before;
+      frames.push_back(frame);
+
+      source = block;
+      start_pc = block_start;
+      end_pc = block_end;
+      pc = block_start;
+      line = 1;
+    }
+
+    Token leave(Token value){
+      /*
+
+        Finishes a single pass through the current nested block, resuming the suspended block once all passes are done.
+        Every pass counts as a step, so that even loops with empty bodies run out of budget and quota.
+
+      */
+
+      steps++;
+      if (step_quota > 0 && steps > step_quota){
+        return Token("run_error", "Step quota exceeded");
+      }
+
+      Frame& frame = frames.back();
+      if (frame.repeat > 1){
+        frame.repeat--;
+        pc = start_pc;
+        line = 1;
+        return Token("run_type", "STEP");
+      }
+
+      source = frame.tokens;
+      start_pc = frame.start_pc;
+      end_pc = frame.end_pc;
+      pc = frame.pc;
+      line = frame.line;
+      if (frame.kind != ""){
+        record_stats(stats_statements, frame.kind, frame.allocations_before, frame.bytes_before, frame.tokens_before);
+      }
+
+      if (frame.function != ""){
+        record_stats(stats_functions, frame.function, frame.allocations_before, frame.bytes_before, frame.tokens_before);
+        memo_store(frame.function, value);
+      }
+
+      if (frame.restart){
+        // Hand the result to the statement which called the function, with its counters snapshot
+        call_result = value;
+        call_ready = true;
+        call_allocations_before = frame.allocations_before;
+        call_bytes_before = frame.bytes_before;
+        call_tokens_before = frame.tokens_before;
+      }
+
+      frames.pop_back();
+      return Token("run_type", "STEP");
+    }
+
+    Token step(){
+      /*
+
+        Executes a single statement and returns Token("run_type", "STEP") while there is more to execute.
+        Once the program finishes it returns what execute() would have returned.
+        Nested blocks are not executed recursively, they are pushed as frames so that execution can be suspended between any two statements.
+
+      */
+
+      if (step_quota > 0 && steps >= step_quota){
+        return Token("run_error", "Step quota exceeded");
+      }
+
+      const std::vector<Token>& tokens = *source; // Stays alive while nested blocks run, since frames share it
+      if (pc >= end_pc){
+        if (frames.empty()){
+          return Token("run_type", "SUCCESS"); // SUCCESS indicates succesfull execution
         }
 
-        if (curr.type == "keyword"){
-          if (curr.value == "dec"){
-            // Variable declaration
-            Token name = tokens[i + 1];
-            if (name.type == "unknown"){
-              Token symbol = tokens[i + 2];
-              if (symbol.type == "symbol" &&  symbol.value == "="){
+        return leave(Token("run_type", "SUCCESS"));
+      }
+
+      steps++;
+      size_t i = pc; // Current token index
+      Token curr = tokens[i];
+      if (curr.type == "newline"){
+        line++;
+        pc++;
+        return Token("run_type", "STEP");
+      }
+
+      // Snapshot the counters so the statement's cost can be attributed to its kind
+      // A restarted statement keeps the snapshot from before its call, so the function's cost is included
+      tokens_evaluated++;
+      const std::string kind = stats_enabled ? statement_kind(i) : "";
+      const size_t allocations_before = call_ready ? call_allocations_before : thread_allocations;
+      const size_t bytes_before = call_ready ? call_bytes_before : thread_bytes;
+      const size_t tokens_before = call_ready ? call_tokens_before : tokens_evaluated;
+
+      // A nested block to be entered once the statement ends
+      std::shared_ptr<const std::vector<Token>> block;
+      size_t block_start = 0;
+      size_t block_end = 0;
+      size_t block_repeat = 1;
+      std::string block_function = "";
+      bool block_pending = false;
+
+      if (curr.type == "keyword"){
+        if (curr.value == "dec"){
+          // Variable declaration
+          Token name = tokens[i + 1];
+          if (name.type == "unknown"){
+            Token symbol = tokens[i + 2];
+            if (symbol.type == "symbol" &&  symbol.value == "="){
 
+              
+              Token value = tokens[i + 3];
+              if (value.type == "string" || value.type == "number" || value.type == "boolean" || value.type == "array"){
+                // We want to remove the quotation marks from strings
+                std::vector<std::string> memoryVariable = constructMemoryVariable(
+                  value.type,
+                  name.value, 
+                  value.type == "string" ? value.value.substr(1, value.value.length() - 2) : value.value
+                );
                 
-                Token value = tokens[i + 3];
-                if (value.type == "string" || value.type == "number" || value.type == "boolean" || value.type == "array"){
-                  // We want to remove the quotation marks from strings
-                  std::vector<std::string> memoryVariable = constructMemoryVariable(
-                    value.type,
-                    name.value, 
-                    value.type == "string" ? value.value.substr(1, value.value.length() - 2) : value.value
-                  );
-                  
-                  memory.push_back(memoryVariable);
-                  i = i + 3;
+                memory.push_back(memoryVariable);
+                write_variable(name.value);
+                i = i + 3;
+              }
+              
+              // It may be containing an expression within, such as var x = (...), therefore we should check for brackets.
+              if (value.type == "symbol" && value.value == "("){
+                std::vector<Token> arguments_tokens;
+                int j;
+                std::tie(arguments_tokens, j) = get_nested_tokens(i + 4, "(", ")");
+
+                i = j;
+                Token brackets_value = evaluate_experssion(arguments_tokens);
+                if (call_body){
+                  return suspend(allocations_before, bytes_before, tokens_before);
                 }
-                
-                // It may be containing an expression within, such as var x = (...), therefore we should check for brackets.
-                if (value.type == "symbol" && value.value == "("){
-                  std::vector<Token> arguments_tokens;
-                  int j;
-                  std::tie(arguments_tokens, j) = get_nested_tokens(i + 4, "(", ")");
 
-                  i = j;
-                  Token brackets_value = evaluate_experssion(arguments_tokens);
-                  std::vector<std::string> memoryVariable = constructMemoryVariable(
-                    brackets_value.type,
-                    name.value, 
-                    brackets_value.type == "string" ? brackets_value.value.substr(1, brackets_value.value.length() - 2) : brackets_value.value
-                  );
-
-                  memory.push_back(memoryVariable);
-                }
+                std::vector<std::string> memoryVariable = constructMemoryVariable(
+                  brackets_value.type,
+                  name.value, 
+                  brackets_value.type == "string" ? brackets_value.value.substr(1, brackets_value.value.length() - 2) : brackets_value.value
+                );
+
+                memory.push_back(memoryVariable);
+                write_variable(name.value);
               }
             }
           }
-          
-          if (curr.value == "print"){
-            // Printing
-            const Token left_bracket = tokens[i + 1];
-            if (left_bracket.type == "symbol" && left_bracket.value == "("){
-              // We have captured all the code within the for print's boundaries
-              std::vector<Token> arguments_tokens;
-              int j;
-              std::tie(arguments_tokens, j) = get_nested_tokens(i + 2, "(", ")");
-              
-              i = j;
-              Token value = evaluate_experssion(arguments_tokens);
-              if (value.type == "string" || value.type == "number" || value.type == "boolean" || value.type == "array"){
-                output_log(value.value, l);
-              }
+        }
+        
+        if (curr.value == "print"){
+          // Printing
+          const Token left_bracket = tokens[i + 1];
+          if (left_bracket.type == "symbol" && left_bracket.value == "("){
+            // We have captured all the code within the for print's boundaries
+            std::vector<Token> arguments_tokens;
+            int j;
+            std::tie(arguments_tokens, j) = get_nested_tokens(i + 2, "(", ")");
+            
+            i = j;
+            Token value = evaluate_experssion(arguments_tokens);
+            if (call_body){
+              return suspend(allocations_before, bytes_before, tokens_before);
+            }
+
+            if (value.type == "string" || value.type == "number" || value.type == "boolean" || value.type == "array"){
+              output_log(value.value, line);
             }
           }
+        }
 
-          if (curr.value == "for"){
-            // For loop declaration
-            const Token loop_variable = tokens[i + 1];
-            if (loop_variable.type == "unknown"){
-              const Token symbol_one = tokens[i + 2];
-              if (symbol_one.type == "symbol" && symbol_one.value == "="){
-                const Token left_bracket = tokens[i + 3];
-                if (left_bracket.type == "symbol" && left_bracket.value == "(")
-                {
-                  const Token start = tokens[i + 4];
-                  if (start.type == "number"){
-                    const Token symbol_two = tokens[i + 5];
-                    if (symbol_two.type == "symbol" && symbol_two.value == ","){
-                      const Token end = tokens[i + 6];
-                      if (end.type == "number"){
-                        // We thus far have a for loop with: for loop_variable (start,end)
-                        const Token symbol_three = tokens[i + 7];
-                        if (symbol_three.type == "symbol" && symbol_three.value == ")")
-                        {
-                          const Token symbol_four = tokens[i + 8];
-                          if (symbol_four.type == "symbol" && symbol_four.value == "{"){
-                            // We need to capture all the code within the for loop's boundaries
-                            std::vector<Token> exceution_tokens;
-                            
-                            int j;
-                            std::tie(exceution_tokens, j) = get_nested_tokens(i + 9, "{", "}");
-  
-                            // We have captured all the code within the for loop's boundaries
-                            for (int k = std::stof(start.value); k <= std::stof(end.value); k++){
-                              execute(exceution_tokens);
-                            }
-                            
-                            i = j;
-                          }
+        if (curr.value == "for"){
+          // For loop declaration
+          const Token loop_variable = tokens[i + 1];
+          if (loop_variable.type == "unknown"){
+            const Token symbol_one = tokens[i + 2];
+            if (symbol_one.type == "symbol" && symbol_one.value == "="){
+              const Token left_bracket = tokens[i + 3];
+              if (left_bracket.type == "symbol" && left_bracket.value == "(")
+              {
+                const Token start = tokens[i + 4];
+                if (start.type == "number"){
+                  const Token symbol_two = tokens[i + 5];
+                  if (symbol_two.type == "symbol" && symbol_two.value == ","){
+                    const Token end = tokens[i + 6];
+                    if (end.type == "number"){
+                      // We thus far have a for loop with: for loop_variable (start,end)
+                      const Token symbol_three = tokens[i + 7];
+                      if (symbol_three.type == "symbol" && symbol_three.value == ")")
+                      {
+                        const Token symbol_four = tokens[i + 8];
+                        if (symbol_four.type == "symbol" && symbol_four.value == "{"){
+                          // We need to find the end of the for loop's boundaries, the body is run in place within source
+                          const size_t j = find_closing(i + 9, "{", "}");
+
+                          // We have found all the code within the for loop's boundaries, the body is entered once this statement ends
+                          // Counted like for (int k = start; k <= end; k++), which truncates a decimal start but not the end
+                          const int first = std::stof(start.value);
+                          const float last = std::stof(end.value);
+                          block = source;
+                          block_start = std::min(i + 9, j);
+                          block_end = j;
+                          block_repeat = last >= first ? static_cast<size_t>(last - first) + 1 : 0;
+                          block_pending = true;
+                          
+                          i = j;
                         }
                       }
                     }
@@ -626,139 +1374,341 @@ class Interpreter{
               }
             }
           }
+        }
 
-          if (curr.value == "function"){
-            // Function declaration
-            const Token name = tokens[i + 1];
-            if (name.type == "unknown"){
+        if (curr.value == "function"){
+          // Function declaration
+          const Token name = tokens[i + 1];
+          if (name.type == "unknown"){
 
-              const Token symbol_one = tokens[i + 2];
-              if (symbol_one.type == "symbol" && symbol_one.value == "("){
+            const Token symbol_one = tokens[i + 2];
+            if (symbol_one.type == "symbol" && symbol_one.value == "("){
 
-                // Without any passed in arguments
-                const Token symbol_two = tokens[i + 3];
-                if (symbol_two.type == "symbol" && symbol_two.value == ")"){
-                  // We thus far have a function with a syntax: function name()
-                  const Token symbol_three = tokens[i + 4];
-                  if (symbol_three.type == "symbol" && symbol_three.value == "{"){
+              // Without any passed in arguments
+              const Token symbol_two = tokens[i + 3];
+              if (symbol_two.type == "symbol" && symbol_two.value == ")"){
+                // We thus far have a function with a syntax: function name()
+                const Token symbol_three = tokens[i + 4];
+                if (symbol_three.type == "symbol" && symbol_three.value == "{"){
 
-                    std::vector<Token> nested_tokens;
-                    int j;
-                    std::tie(nested_tokens, j) = get_nested_tokens(i + 5, "{", "}");
+                  // The body is only compiled once the function is first called
+                  const size_t j = find_closing(i + 5, "{", "}");
 
-                    // Insert the function into the functions memory
-                    memory_functions.push_back(std::make_tuple(name.value, nested_tokens));
+                  // Insert the function into the functions memory
+                  memory_functions.push_back(std::make_tuple(name.value, FunctionBody(source, std::min(i + 5, j), j)));
 
-                    i = j;
-                  }
+                  i = j;
                 }
               }
             }
           }
+        }
 
-          if (curr.value == "if"){
-            // If statement
-            const Token symbol_one = tokens[i + 1];
-            if (symbol_one.type == "symbol" && symbol_one.value == "("){
-              std::vector<Token> arguments_tokens;
-              int j;
-              std::tie(arguments_tokens, j) = get_nested_tokens(i + 2, "(", ")");
-
-              i = j;
-              Token value = evaluate_experssion(arguments_tokens);
-              if ((value.type == "boolean") && (value.value == "true" || value.value == "false")){
-                const Token symbol_two = tokens[i];
-                if (symbol_two.type == "symbol" && symbol_two.value == ")"){
-                  const Token symbol_three = tokens[i + 1];
-                  if (symbol_three.type == "symbol" && symbol_three.value == "{"){
-                    // We need to capture all the code within the condition's boundaries
-                    std::vector<Token> exceution_tokens;
-                    int j;
-                    std::tie(exceution_tokens, j) = get_nested_tokens(i + 2, "{", "}");
-
-                    // We have captured all the code within the for loop's boundaries
-                    i = j;
-                    
-                    if (value.value == "true"){
-                      execute(exceution_tokens);
-                    }
+        if (curr.value == "if"){
+          // If statement
+          const Token symbol_one = tokens[i + 1];
+          if (symbol_one.type == "symbol" && symbol_one.value == "("){
+            std::vector<Token> arguments_tokens;
+            int j;
+            std::tie(arguments_tokens, j) = get_nested_tokens(i + 2, "(", ")");
+
+            i = j;
+            Token value = evaluate_experssion(arguments_tokens);
+            if (call_body){
+              return suspend(allocations_before, bytes_before, tokens_before);
+            }
+
+            if ((value.type == "boolean") && (value.value == "true" || value.value == "false")){
+              const Token symbol_two = tokens[i];
+              if (symbol_two.type == "symbol" && symbol_two.value == ")"){
+                const Token symbol_three = tokens[i + 1];
+                if (symbol_three.type == "symbol" && symbol_three.value == "{"){
+                  // We need to find the end of the condition's boundaries, the body is run in place within source
+                  const size_t j = find_closing(i + 2, "{", "}");
+
+                  if (value.value == "true"){
+                    block = source;
+                    block_start = std::min(i + 2, j);
+                    block_end = j;
+                    block_pending = true;
                   }
+
+                  i = j;
                 }
               }
             }
           }
+        }
 
-          if (curr.value == "return"){
-            // Return statement
-            const Token left_bracket = tokens[i + 1];
-            if (left_bracket.type == "symbol" && left_bracket.value == "("){
-              std::vector<Token> arguments_tokens;
-              int j;
-              std::tie(arguments_tokens, j) = get_nested_tokens(i + 2, "(", ")");
+        if (curr.value == "return"){
+          // Return statement
+          const Token left_bracket = tokens[i + 1];
+          if (left_bracket.type == "symbol" && left_bracket.value == "("){
+            std::vector<Token> arguments_tokens;
+            int j;
+            std::tie(arguments_tokens, j) = get_nested_tokens(i + 2, "(", ")");
+
+            i = j;
+            Token value = evaluate_experssion(arguments_tokens);
+            if (call_body){
+              return suspend(allocations_before, bytes_before, tokens_before);
+            }
 
-              i = j;
-              Token value = evaluate_experssion(arguments_tokens);
+            record_stats(stats_statements, kind, allocations_before, bytes_before, tokens_before);
+            if (frames.empty()){
+              // Returning from the program itself ends the execution
+              pc = end_pc;
               return value;
             }
+
+            return leave(value);
           }
         }
+      }
 
-        if (curr.type == "unknown"){
-          const Token name = curr;
-          const Token symbol_one = tokens[i + 1];
-          if (symbol_one.type == "symbol" && symbol_one.value == "("){
-            const Token symbol_two = tokens[i + 2];
-
-            if (symbol_two.type == "symbol" && symbol_two.value == ")"){
-              // We now will execute that function
-              run_function(name.value);
-
-              i = i + 2;
+      if (curr.type == "unknown"){
+        const Token name = curr;
+        const Token symbol_one = tokens[i + 1];
+        if (symbol_one.type == "symbol" && symbol_one.value == "("){
+          const Token symbol_two = tokens[i + 2];
+
+          if (symbol_two.type == "symbol" && symbol_two.value == ")"){
+            // We now will execute that function, its body is entered once this statement ends
+            // Pure functions with a cached result have no side effects, so the call can be skipped
+            Token cached = Token("", "");
+            if (!memo_lookup(name.value, cached)){
+              for (unsigned int k = 0; k < memory_functions.size(); k++){
+                if (std::get<0>(memory_functions.get(k)) == name.value){
+                  block = std::get<1>(memory_functions.get(k)).compile();
+                  block_end = block->size();
+                  block_function = name.value;
+                  block_pending = true;
+                  break;
+                }
+              }
             }
+
+            i = i + 2;
           }
+        }
 
-          // There might be an attempt to assign a value to some variable
-          if (symbol_one.type == "symbol" && symbol_one.value == "="){
-            const Token assigned_value = tokens[i + 2];
-            for (unsigned int i = 0; i < memory.size(); i++){
-              // We need to find the variable with a matching name
-              if (memory[i][1] == curr.value){
-                // Update the variable's type and value
-                memory[i][0] = assigned_value.type;
-                memory[i][2] = assigned_value.value;
-              }
+        // There might be an attempt to assign a value to some variable
+        if (symbol_one.type == "symbol" && symbol_one.value == "="){
+          const Token assigned_value = tokens[i + 2];
+          for (unsigned int i = 0; i < memory.size(); i++){
+            // We need to find the variable with a matching name
+            if (memory.get(i)[1] == curr.value){
+              // Update the variable's type and value
+              std::vector<std::string>& variable = memory.edit(i);
+              variable[0] = assigned_value.type;
+              variable[2] = assigned_value.value;
+              write_variable(curr.value);
             }
           }
         }
-        
-        i++;
       }
 
-      return Token("run_type", "SUCCESS"); // SUCCESS indicates succesfull execution
+      call_ready = false; // A result which was not picked up again belongs to no one
+      pc = i + 1;
+      if (block_pending){
+        enter(block, block_start, block_end, block_repeat, kind, block_function, allocations_before, bytes_before, tokens_before);
+      } else if (kind != ""){
+        record_stats(stats_statements, kind, allocations_before, bytes_before, tokens_before);
+      }
+
+      return Token("run_type", "STEP");
     }
 
-    Token execute(std::vector<Token> local_tokens){
-      std::vector<Token> old_tokens = tokens;
-      tokens = local_tokens;
-      Token ret = execute();
-      tokens = old_tokens;
+    Token execute(){
+      // Runs the program to completion
+      Token ret = Token("run_type", "STEP");
+      while (ret.type == "run_type" && ret.value == "STEP"){
+        ret = step();
+      }
+
       return ret;
     }
 
+    Token suspend(size_t allocations_before, size_t bytes_before, size_t tokens_before){
+      // Suspends the current statement until the function requested by run_function returns, then restarts it
+      std::shared_ptr<const std::vector<Token>> body = call_body;
+      call_body.reset();
+      enter(body, 0, body->size(), 1, "", call_function, allocations_before, bytes_before, tokens_before);
+      frames.back().restart = true; // The frame resumes at pc, which still points at the start of this statement
+      return Token("run_type", "STEP");
+    }
+
+    Token run(size_t budget){
+      /*
+
+        Executes statements until roughly `budget` steps have passed, then yields.
+        Returns Token("run_type", "STEP") if the program should be resumed by calling run() again.
+        At least one step is always taken, so a budget of 0 still makes progress.
+
+      */
+
+      const size_t start = steps;
+      Token ret = Token("run_type", "STEP");
+      do {
+        ret = step();
+      } while (steps - start < budget && ret.type == "run_type" && ret.value == "STEP");
+
+      if (ret.type == "run_type" && ret.value == "STEP" && memory_quota > 0 && memory_usage() > memory_quota){
+        return Token("run_error", "Memory quota exceeded");
+      }
+
+      return ret;
+    }
+
+    size_t memory_usage(){
+      // Approximate number of bytes held by the variables, functions and suspended blocks of this interpreter
+      // Variables and functions shared with forked interpreters are counted by each of them
+      size_t bytes = 0;
+      std::vector<const std::vector<Token>*> buffers; // Token buffers are shared by blocks, frames and function bodies, each is counted once
+      buffers.push_back(source.get());
+      for (unsigned int i = 0; i < memory.size(); i++){
+        const std::vector<std::string>& variable = memory.get(i);
+        for (unsigned int j = 0; j < variable.size(); j++){
+          bytes += sizeof(std::string) + variable[j].capacity();
+        }
+      }
+
+      for (unsigned int i = 0; i < memory_functions.size(); i++){
+        const std::tuple<std::string, FunctionBody>& function = memory_functions.get(i);
+        bytes += std::get<0>(function).capacity() + sizeof(FunctionBody);
+        const std::vector<Token>* declared_in = std::get<1>(function).source.get();
+        if (std::find(buffers.begin(), buffers.end(), declared_in) == buffers.end()){
+          buffers.push_back(declared_in);
+        }
+
+        const std::vector<Token>* compiled = std::get<1>(function).compiled();
+        if (compiled != nullptr && std::find(buffers.begin(), buffers.end(), compiled) == buffers.end()){
+          buffers.push_back(compiled);
+        }
+      }
+
+      for (unsigned int i = 0; i < frames.size(); i++){
+        bytes += sizeof(Frame);
+        if (std::find(buffers.begin(), buffers.end(), frames[i].tokens.get()) == buffers.end()){
+          buffers.push_back(frames[i].tokens.get());
+        }
+      }
+
+      for (unsigned int i = 0; i < buffers.size(); i++){
+        bytes += buffers[i]->capacity() * sizeof(Token);
+      }
+
+      bytes += memo_functions.size() * sizeof(FunctionMemo);
+
+      return bytes;
+    }
+
+
     void printMemory(){
       std::cout << std::endl << std::endl;
       std::cout << "Full Memory Log: " << std::endl;
       for (unsigned int i = 0; i < memory.size(); i++){
-        std::cout << "[" << memory[i][0] << ", " << memory[i][1] << " = " << memory[i][2] << "]" << std::endl;
+        const std::vector<std::string>& variable = memory.get(i);
+        std::cout << "[" << variable[0] << ", " << variable[1] << " = " << variable[2] << "]" << std::endl;
       }
 
       for (unsigned int i = 0; i < memory_functions.size(); i++){
-        std::cout << "[" << std::get<0>(memory_functions[i]) << "]" << std::endl;
+        std::cout << "[" << std::get<0>(memory_functions.get(i)) << "]" << std::endl;
+      }
+    }
+
+    void printStats(){
+      stats_paused = true; // Printing should not be counted
+      std::cout << std::endl << std::endl;
+      std::cout << "Runtime Statistics: " << std::endl;
+      std::cout << "Total allocations: " << stats_allocations << std::endl;
+      std::cout << "Total bytes allocated: " << stats_bytes << std::endl;
+      const size_t peak = peakResidentMemory();
+      if (peak > 0){
+        std::cout << "Peak resident memory: " << peak << " KB" << std::endl;
+      } else {
+        std::cout << "Peak resident memory: unavailable" << std::endl;
+      }
+      std::cout << "Tokens evaluated: " << tokens_evaluated << std::endl;
+
+      std::cout << "Per statement:" << std::endl;
+      for (unsigned int i = 0; i < stats_statements.size(); i++){
+        stats_statements[i].print();
+      }
+
+      std::cout << "Per function:" << std::endl;
+      for (unsigned int i = 0; i < stats_functions.size(); i++){
+        stats_functions[i].print();
+      }
+      stats_paused = false;
+    }
+};
+
+class Scheduler{
+  /*
+
+    Interleaves many interpreter instances on a single thread.
+    Each instance runs for at most `budget` steps before the next one gets its turn, so a long running script does not hold back the short ones.
+    Instances which exceed their step or memory quota are aborted.
+
+  */
+
+  public:
+    size_t budget;
+    std::deque<Interpreter> instances;
+    std::vector<Token> results; // What each instance's execution has returned, in the order they were added
+
+    Scheduler(size_t budget) : budget(budget) {}
+
+    size_t add(Interpreter instance){
+      // Queues an instance for execution and returns its index within results
+      instances.push_back(std::move(instance));
+      results.push_back(Token("run_type", "STEP"));
+      return instances.size() - 1;
+    }
+
+    void run(){
+      std::deque<size_t> ready; // Instances which still have statements left to execute, in round robin order
+      for (size_t i = 0; i < instances.size(); i++){
+        if (results[i].type == "run_type" && results[i].value == "STEP"){
+          ready.push_back(i);
+        }
+      }
+
+      while (!ready.empty()){
+        const size_t index = ready.front();
+        ready.pop_front();
+
+        Interpreter& instance = instances[index];
+        Token ret = instance.run(budget);
+        if (ret.type == "run_type" && ret.value == "STEP"){
+          ready.push_back(index); // Yielded, resume it once every other instance had its turn
+          continue;
+        }
+
+        if (ret.type == "run_error"){
+          instance.output_log("Script " + std::to_string(index) + " aborted: " + ret.value, instance.line);
+        }
+
+        results[index] = ret;
       }
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+  bool variants = false;
+  for (int i = 1; i < argc; i++){
+    if (std::string(argv[i]) == "--stats"){
+      // Report allocations, memory and evaluated tokens once execution finishes
+      stats_enabled = true;
+    }
+
+    if (std::string(argv[i]) == "--variants"){
+      // Fork variants of the program and interleave them on a scheduler
+      variants = true;
+    }
+  }
+
   std::cout << std::endl << std::endl;
   std::cout << "Program Execution Output:" << std::endl;
 
@@ -773,4 +1723,30 @@ int main() {
   Interpreter intr = Interpreter(tokens);
   intr.execute();
   intr.printMemory();
+
+  if (stats_enabled){
+    // Only the program above is reported, the variants would be counted in the totals but not in its tables
+    intr.printStats();
+    stats_enabled = false;
+  }
+
+  if (variants){
+    // The program acts as a prelude, each variant runs on top of its variables without executing it again
+    std::cout << std::endl << std::endl;
+    std::cout << "Variants Execution Output:" << std::endl;
+
+    std::string long_variant = "function count(){ for i = (1, 1000){ t = 6 } return (t) } print(count())";
+    std::string short_variant = "print(t) dec c = 1 print(c)";
+    Scheduler scheduler = Scheduler(16);
+    scheduler.add(intr.fork(Lexer(long_variant).tokenize()));
+    scheduler.add(intr.fork(Lexer(short_variant).tokenize()));
+    scheduler.run();
+
+    for (unsigned int i = 0; i < scheduler.instances.size(); i++){
+      scheduler.instances[i].printMemory();
+    }
+
+    // The variants have written to their own copies, so the program's memory is unchanged
+    intr.printMemory();
+  }
 }